@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Turns a kernel trace dump into latency histograms.
+
+The kernel (see trace.H/trace.C in MP1-MP4 and MP6) sends its events on
+COM1. bochs writes them to trace.bin ('com1: enabled=1, mode=file,
+dev=trace.bin' in bochsrc.bxrc); then run
+
+    tools/trace_analyze.py trace.bin [--mhz 2400]
+
+The dump is a sequence of batches. A batch is the magic "TRCE", the number
+of events as a 32-bit little-endian integer, and that many 16-byte events:
+
+    u64 tsc, u16 type, u16 info, u32 arg
+
+Anything between batches (e.g. console output that also went to COM1) is
+skipped. Times are in TSC cycles, or in microseconds with --mhz.
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+MAGIC = b"TRCE"
+EVENT = struct.Struct("<QHHI")
+
+# Keep in sync with TRACE_EVENT in trace.H.
+LOST = 0
+IRQ_ENTER = 1
+IRQ_EXIT = 2
+FAULT_BEGIN = 3
+FAULT_END = 4
+FRAME_ALLOC = 5
+FRAME_FREE = 6
+PAGE_FREE = 7
+VM_ALLOC = 8
+VM_RELEASE = 9
+THREAD_CREATE = 10
+SWITCH = 11
+DISK_SUBMIT = 12
+DISK_COMPLETE = 13
+
+NAMES = {
+    LOST: "lost",
+    IRQ_ENTER: "irq enter",
+    IRQ_EXIT: "irq exit",
+    FAULT_BEGIN: "fault begin",
+    FAULT_END: "fault end",
+    FRAME_ALLOC: "frame alloc",
+    FRAME_FREE: "frame free",
+    PAGE_FREE: "page free",
+    VM_ALLOC: "vm alloc",
+    VM_RELEASE: "vm release",
+    THREAD_CREATE: "thread create",
+    SWITCH: "switch",
+    DISK_SUBMIT: "disk submit",
+    DISK_COMPLETE: "disk complete",
+}
+
+
+def parse(data):
+    """Returns the list of (tsc, type, info, arg) in the dump."""
+    events = []
+    pos = 0
+    while True:
+        pos = data.find(MAGIC, pos)
+        if pos < 0 or pos + 8 > len(data):
+            break
+        (count,) = struct.unpack_from("<I", data, pos + 4)
+        start = pos + 8
+        end = start + count * EVENT.size
+        if end > len(data):
+            # cut off at the end of the capture
+            count = (len(data) - start) // EVENT.size
+            end = start + count * EVENT.size
+        batch = [EVENT.unpack_from(data, start + i * EVENT.size) for i in range(count)]
+        if any(e[1] not in NAMES for e in batch):
+            # not a real header, just the bytes "TRCE" somewhere else
+            pos += 1
+            continue
+        events.extend(batch)
+        pos = end
+    return events
+
+
+class Latencies:
+    """Durations collected under one name."""
+
+    def __init__(self, name):
+        self.name = name
+        self.values = []
+
+    def add(self, cycles):
+        self.values.append(cycles)
+
+
+def analyze(events):
+    faults = Latencies("page fault")
+    disk = Latencies("disk request (submit to complete)")
+    irqs = defaultdict(lambda: None)
+    runs = defaultdict(lambda: None)
+    counts = defaultdict(int)
+    lost = 0
+    irq_switched = 0
+
+    fault_stack = []
+    disk_pending = defaultdict(list)       # (block, n) -> submit times
+    irq_pending = {}                       # (thread, irq) -> (enter time, switches)
+    current = None
+    run_start = None
+    n_switches = 0
+
+    for tsc, kind, info, arg in events:
+        counts[kind] += 1
+        if kind == LOST:
+            lost += arg
+        elif kind == FAULT_BEGIN:
+            fault_stack.append(tsc)
+        elif kind == FAULT_END:
+            if fault_stack:
+                faults.add(tsc - fault_stack.pop())
+        elif kind == DISK_SUBMIT:
+            disk_pending[(arg, info)].append(tsc)
+        elif kind == DISK_COMPLETE:
+            pending = disk_pending.get((arg, info))
+            if pending:
+                disk.add(tsc - pending.pop(0))
+        elif kind == IRQ_ENTER:
+            irq_pending[(current, info)] = (tsc, n_switches)
+        elif kind == IRQ_EXIT:
+            entry = irq_pending.pop((current, info), None)
+            if entry is not None:
+                enter, switches = entry
+                if switches != n_switches:
+                    # the handler switched threads; the time includes other threads
+                    irq_switched += 1
+                else:
+                    if irqs[info] is None:
+                        irqs[info] = Latencies("IRQ %d handler" % info)
+                    irqs[info].add(tsc - enter)
+        elif kind == SWITCH:
+            n_switches += 1
+            if current is not None and run_start is not None:
+                if runs[current] is None:
+                    runs[current] = Latencies("thread %d run length" % current)
+                runs[current].add(tsc - run_start)
+            current = arg
+            run_start = tsc
+
+    groups = [faults, disk]
+    groups += [irqs[k] for k in sorted(irqs) if irqs[k] is not None]
+    groups += [runs[k] for k in sorted(runs) if runs[k] is not None]
+    return groups, counts, lost, irq_switched
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def fmt(cycles, mhz):
+    if mhz:
+        return "%.1fus" % (cycles / mhz)
+    return "%d" % cycles
+
+
+def print_histogram(lat, mhz, width=40):
+    values = sorted(lat.values)
+    if not values:
+        return
+    print("%s: %d samples" % (lat.name, len(values)))
+    print("  min %s  median %s  p99 %s  max %s" % (
+        fmt(values[0], mhz), fmt(percentile(values, 0.5), mhz),
+        fmt(percentile(values, 0.99), mhz), fmt(values[-1], mhz)))
+
+    buckets = defaultdict(int)
+    for v in values:
+        buckets[max(v, 1).bit_length() - 1] += 1
+    top = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets[b]
+        bar = "#" * ((n * width + top - 1) // top)
+        print("  %12s .. %-12s %7d %s" % (
+            fmt(1 << b, mhz), fmt((1 << (b + 1)) - 1, mhz), n, bar))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("dump", help="file that captured COM1")
+    parser.add_argument("--mhz", type=float, default=0,
+                        help="TSC frequency, to print microseconds instead of cycles")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        events = parse(f.read())
+    if not events:
+        print("no trace events in %s" % args.dump)
+        return 1
+
+    groups, counts, lost, irq_switched = analyze(events)
+
+    print("%d events over %s" % (len(events), fmt(events[-1][0] - events[0][0], args.mhz)))
+    for kind in sorted(counts):
+        print("  %-14s %d" % (NAMES[kind], counts[kind]))
+    if lost:
+        print("  %d events were lost; flush more often or enlarge the ring" % lost)
+    if irq_switched:
+        print("  %d handlers switched threads and are not in the IRQ histograms" % irq_switched)
+    print()
+
+    for lat in groups:
+        print_histogram(lat, args.mhz)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())